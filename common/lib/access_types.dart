@@ -25,6 +25,9 @@ EntityAccessLevel _standardAccessLevelRule(EntityAccessLevel fileAccessLevel)
   return fileAccessLevel; // results in an access mode matching the file's access level
 }
 
+// set by user execution on trusted executables, to the privilege level of the user running them
+const String USER_ACCESS_PRIVILEGE_ENV_VAR = "USER_ACCESS_PRIVILEGE";
+
 // the privilege level of the current user
 enum UserAccessPrivilege
 {
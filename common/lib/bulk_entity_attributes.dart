@@ -0,0 +1,282 @@
+import "dart:async";
+import "dart:io";
+import "dart:isolate";
+import "package:path/path.dart" as path_util;
+import "package:glob/glob.dart";
+import "package:common/constants/special_entity_path_segments.dart";
+import "package:common/entity_attributes_stores.dart";
+import "package:common/util.dart";
+
+/** @fileoverview Sets an entity attribute on every entity matched by an expression, in bulk.
+ *
+ *    Directories are handed out one at a time from a shared work queue to a pool of worker isolates,
+ *    so uneven trees still keep every worker busy. Matched entities are grouped by their containing
+ *    directory, so each directory's store file is read & written only once.
+ * */
+
+const String _GLOB_SYNTAX_CHARACTERS = "*?[{\\";
+
+class BulkSetProgress
+{
+  int directoryCount;
+
+  int entityCount;
+
+  BulkSetProgress({
+    int this.directoryCount = 0,
+    int this.entityCount = 0
+  });
+
+  void add(BulkSetProgress other)
+  {
+    directoryCount += other.directoryCount;
+    entityCount += other.entityCount;
+  }
+
+  @override
+  String toString()
+  {
+    return "${entityCount} entities in ${directoryCount} directories";
+  }
+}
+
+// the summary line printed by the tools once a bulk set completes
+String describeBulkSetResult(BulkSetProgress progress, bool dryRun, Duration elapsed)
+{
+  return "${dryRun ? "Would update" : "Updated"} ${progress} after ${elapsed.inMilliseconds}ms";
+}
+
+// what every worker isolate needs, sent once on spawn
+class _BulkSetWorkerConfig
+{
+  final String storeName;
+
+  final String globPattern;
+
+  final String value;
+
+  final bool dryRun;
+
+  /** deepest directory (below the base path) that can hold a match, null when unbounded (**) */
+  final int? maxDepth;
+
+  final SendPort coordinatorPort;
+
+  _BulkSetWorkerConfig({
+    required String this.storeName,
+    required String this.globPattern,
+    required String this.value,
+    required bool this.dryRun,
+    required int? this.maxDepth,
+    required SendPort this.coordinatorPort
+  });
+}
+
+// a directory to commit, with its depth below the pattern's base path (the base itself is 0)
+class _DirectoryWork
+{
+  final String path;
+
+  final int depth;
+
+  _DirectoryWork(String this.path, int this.depth);
+}
+
+// sent by a worker when it is ready for more work, with the result of the work it just finished (if any)
+class _WorkerIdle
+{
+  final SendPort workerPort;
+
+  /** null on the first message, when the worker has not yet been given work */
+  final List<_DirectoryWork>? subdirectories;
+
+  final int matchedCount;
+
+  _WorkerIdle(SendPort this.workerPort, List<_DirectoryWork>? this.subdirectories, int this.matchedCount);
+}
+
+bool _segmentHasGlobSyntax(String segment)
+{
+  return segment.split("").any(_GLOB_SYNTAX_CHARACTERS.contains);
+}
+
+// the deepest directory of the pattern before any glob syntax, where the walk begins
+String _getLiteralBasePath(String globPattern)
+{
+  List<String> segments = globPattern.split("/");
+  int literalCount = segments.indexWhere(_segmentHasGlobSyntax);
+  return segments.sublist(0, literalCount).join("/");
+}
+
+// without ** (or braces, which may hold a "/"), matches are exactly as deep as the rest of the pattern
+int? _getMaxDepth(String globPattern, String basePath)
+{
+  String remainingPattern = globPattern.substring(basePath.length + 1);
+  if ( remainingPattern.contains("**") || remainingPattern.contains("{") ) {
+    return null;
+  }
+  return remainingPattern.split("/").length;
+}
+
+// commits matched files directly within the directory
+// returns its subdirectories still to be walked, and the count of entities matched
+Future<(List<_DirectoryWork>, int)> _commitDirectory(_BulkSetWorkerConfig config, Glob glob, EntityAttributesStore store, _DirectoryWork work) async
+{
+  // a subdirectory is only walked if it could still hold a match
+  bool descend = config.maxDepth == null || work.depth + 1 < config.maxDepth!;
+  List<_DirectoryWork> subdirectories = <_DirectoryWork>[];
+  List<String> matchedEntityPaths = <String>[];
+  await for (FileSystemEntity entity in new Directory(work.path).list(followLinks: false) )
+  {
+    // never descend into special segments (.git or .monolith for example)
+    if ( special_entity_path_segments.contains( path_util.basename(entity.path) ) ) {
+      continue;
+    }
+    if (entity is Directory) {
+      if (descend) {
+        subdirectories.add( new _DirectoryWork(entity.path, work.depth + 1) );
+      }
+    }
+    else if ( glob.matches(entity.path) && await FileSystemEntity.isFile(entity.path) ) {
+      matchedEntityPaths.add( getEntityPathFromSourcePath(entity.path) );
+    }
+  }
+  if ( matchedEntityPaths.isNotEmpty && !config.dryRun ) {
+    await store.setMany(matchedEntityPaths, config.value);
+  }
+  return (subdirectories, matchedEntityPaths.length);
+}
+
+// runs in each worker isolate: commits one directory at a time, as handed out by the coordinator
+Future<void> _bulkSetWorkerMain(_BulkSetWorkerConfig config) async
+{
+  Glob glob = new Glob(config.globPattern);
+  EntityAttributesStore store = new EntityAttributesStore(storeName: config.storeName);
+  ReceivePort workPort = new ReceivePort();
+  config.coordinatorPort.send( new _WorkerIdle(workPort.sendPort, null, 0) );
+  await for (dynamic message in workPort)
+  {
+    (List<_DirectoryWork>, int) result = await _commitDirectory(config, glob, store, message as _DirectoryWork);
+    config.coordinatorPort.send( new _WorkerIdle(workPort.sendPort, result.$1, result.$2) );
+  }
+}
+
+/** Sets value for every file entity matched by expression (as for getEntityPathsFromExpression)
+ *  @param dryRun -- when true, matches & counts but writes nothing
+ *  @param onProgress -- called with running totals as directories are committed, at most once per progressInterval */
+Future<BulkSetProgress> bulkSetEntityAttribute(
+  EntityAttributesStore store,
+  String expression,
+  String value,
+  {
+    bool dryRun = false,
+    void Function(BulkSetProgress progress)? onProgress,
+    Duration progressInterval = const Duration(seconds: 1)
+  }) async
+{
+  String globPattern = getGlobPatternFromExpression(expression);
+
+  // a literal expression names a single entity, nothing to walk
+  if ( !globPattern.split("/").any(_segmentHasGlobSyntax) ) {
+    if ( pathContainsSpecialSegment(globPattern) || !await FileSystemEntity.isFile(globPattern) ) {
+      return new BulkSetProgress();
+    }
+    if (!dryRun) {
+      await store.set(getEntityPathFromSourcePath(globPattern), value);
+    }
+    return new BulkSetProgress(directoryCount: 1, entityCount: 1);
+  }
+
+  String basePath = _getLiteralBasePath(globPattern);
+  if ( pathContainsSpecialSegment(basePath) || !await new Directory(basePath).exists() ) {
+    return new BulkSetProgress();
+  }
+
+  ReceivePort coordinatorPort = new ReceivePort();
+  ReceivePort errorPort = new ReceivePort();
+  _BulkSetWorkerConfig config = new _BulkSetWorkerConfig(
+    storeName: store.storeName,
+    globPattern: globPattern,
+    value: value,
+    dryRun: dryRun,
+    maxDepth: _getMaxDepth(globPattern, basePath),
+    coordinatorPort: coordinatorPort.sendPort
+  );
+
+  Completer<BulkSetProgress> completer = new Completer<BulkSetProgress>();
+  BulkSetProgress progress = new BulkSetProgress();
+  List<_DirectoryWork> pendingWork = <_DirectoryWork>[ new _DirectoryWork(basePath, 0) ];
+  List<SendPort> idleWorkers = <SendPort>[];
+  List< Future<Isolate?> > spawnedWorkers = < Future<Isolate?> >[];
+  int busyCount = 0;
+  Stopwatch sinceProgress = new Stopwatch()..start();
+
+  void fail(Object error)
+  {
+    if (!completer.isCompleted) {
+      completer.completeError(error);
+    }
+  }
+
+  void dispatch()
+  {
+    if (completer.isCompleted) {
+      return; // failed, hand out no more work
+    }
+    while (pendingWork.isNotEmpty && idleWorkers.isNotEmpty)
+    {
+      idleWorkers.removeLast().send( pendingWork.removeLast() );
+      busyCount++;
+    }
+    // spawn workers lazily, only while there is more work than workers about to become ready
+    int startingCount = spawnedWorkers.length - busyCount - idleWorkers.length;
+    while (pendingWork.length > startingCount && spawnedWorkers.length < Platform.numberOfProcessors)
+    {
+      spawnedWorkers.add(
+        Isolate.spawn(_bulkSetWorkerMain, config, onError: errorPort.sendPort).then<Isolate?>(
+          (Isolate isolate) => isolate,
+          onError: (Object e) { fail(e); return null; }
+        )
+      );
+      startingCount++;
+    }
+    if (pendingWork.isEmpty && busyCount == 0 && !completer.isCompleted) {
+      completer.complete(progress);
+    }
+  }
+
+  coordinatorPort.listen( (dynamic message) {
+    _WorkerIdle idle = message as _WorkerIdle;
+    if (idle.subdirectories != null) {
+      busyCount--;
+      pendingWork.addAll(idle.subdirectories!);
+      if (idle.matchedCount > 0) {
+        progress.add( new BulkSetProgress(directoryCount: 1, entityCount: idle.matchedCount) );
+        if (onProgress != null && sinceProgress.elapsed >= progressInterval) {
+          sinceProgress.reset();
+          onProgress(progress);
+        }
+      }
+    }
+    idleWorkers.add(idle.workerPort);
+    dispatch();
+  });
+  errorPort.listen( (dynamic error) {
+    // uncaught errors arrive as [error, stack trace] strings
+    fail( new Exception("bulk set worker failed: ${(error as List).first}") );
+  });
+
+  try {
+    dispatch();
+    return await completer.future;
+  }
+  finally {
+    coordinatorPort.close();
+    errorPort.close();
+    // on failure other workers may still be mid write, which is safe as store writes are atomic (temporary file & rename)
+    for (Future<Isolate?> worker in spawnedWorkers)
+    {
+      ( await worker )?.kill();
+    }
+  }
+}
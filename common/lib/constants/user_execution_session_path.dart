@@ -0,0 +1,5 @@
+
+/** @fileoverview Path of the user execution service's session endpoint (a WebSocket).
+ *                Outside of /~, so it can never collide with a file path. */
+
+const String user_execution_session_path = "/session";
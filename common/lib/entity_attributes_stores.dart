@@ -1,5 +1,6 @@
 import "dart:convert";
 import "dart:io";
+import "dart:math";
 import "package:mutex/mutex.dart";
 import "package:path/path.dart" as path_util;
 import "package:common/constants/file_system_source_path.dart";
@@ -9,6 +10,8 @@ class EntityAttributesStore
 {
   final Mutex _mutex = new Mutex();
 
+  final Random _random = new Random();
+
   final String storeName;
 
   EntityAttributesStore({
@@ -21,14 +24,18 @@ class EntityAttributesStore
     return path_util.join(path_util.dirname(fullEntityPath), ".monolith");
   }
 
-  // Finds the correct directory for the monolith file
-  File _getStoreFile(String entityPath)
+  File _getStoreFileInDir(String dirName)
   {
-    String dirName = _getStoreFileDirName(entityPath);
     String storePath = path_util.join(dirName, "${storeName}.json");
     return new File(storePath);
   }
 
+  // Finds the correct directory for the monolith file
+  File _getStoreFile(String entityPath)
+  {
+    return _getStoreFileInDir( _getStoreFileDirName(entityPath) );
+  }
+
   Future< Map<String, String> > _getMapFromFile(File storeFile) async
   {
     if ( await storeFile.exists() ) {
@@ -40,6 +47,15 @@ class EntityAttributesStore
     }
   }
 
+  // written to a temporary file & renamed over the store file, so an interrupted write never leaves a truncated store
+  // (the temporary name is unique per writer, as isolates of one process each hold their own mutex)
+  Future<void> _writeMapToFile(File storeFile, Map<String, String> map) async
+  {
+    File temporaryFile = new File("${storeFile.path}.${pid}.${_random.nextInt(1 << 32)}.tmp");
+    await temporaryFile.writeAsString( json.encode(map), flush: true );
+    await temporaryFile.rename(storeFile.path);
+  }
+
   Future<String> get(String entityPath, String defaultValue) async
   {
     // canonicalise the path
@@ -87,7 +103,83 @@ class EntityAttributesStore
       // set value
       map[baseName] = value;
       // save store file
-      await storeFile.writeAsString( json.encode(map) );
+      await _writeMapToFile(storeFile, map);
+    });
+  }
+
+  // groups the entities' base names by the directory holding their store file
+  Map<String, List<String>> _groupBaseNamesByStoreFileDirName(Iterable<String> entityPaths)
+  {
+    Map<String, List<String>> baseNamesByStoreFileDirName = {};
+    for (String entityPath in entityPaths)
+    {
+      // canonicalise the path
+      entityPath = getCanonicalPath(entityPath);
+
+      // if root, skip -- no persistent store for this path
+      if (entityPath == "/") {
+        continue;
+      }
+
+      // avoid entities within a special segment (.git or .monolith for example)
+      if ( pathContainsSpecialSegment( path_util.dirname(entityPath) ) ) {
+        throw new Exception("Cannot set entity attribute for an entity within a hidden directory: \"${entityPath}\".");
+      }
+
+      baseNamesByStoreFileDirName.putIfAbsent(_getStoreFileDirName(entityPath), () => <String>[])
+        .add( path_util.basename(entityPath) );
+    }
+    return baseNamesByStoreFileDirName;
+  }
+
+  // applies update to each directory's map of base names, reading & writing its store file only once
+  Future<void> _updateMany(Iterable<String> entityPaths, bool createStoreFiles, void Function(Map<String, String> map, String baseName) update) async
+  {
+    for (MapEntry<String, List<String>> entry in _groupBaseNamesByStoreFileDirName(entityPaths).entries)
+    {
+      File storeFile = _getStoreFileInDir(entry.key);
+      if ( !createStoreFiles && !await storeFile.exists() ) {
+        continue; // nothing to do
+      }
+      await _mutex.protect( () async {
+        Map<String, String> map = await _getMapFromFile(storeFile);
+        // create .monolith directory if needed.
+        Directory storeFileDirectory = new Directory(entry.key);
+        if ( !await storeFileDirectory.exists() ) {
+          await storeFileDirectory.create();
+        }
+        // update values
+        for (String baseName in entry.value)
+        {
+          update(map, baseName);
+        }
+        // save store file
+        await _writeMapToFile(storeFile, map);
+      });
+    }
+  }
+
+  // Sets the same value on many entities, reading & writing each directory's store file only once
+  Future<void> setMany(Iterable<String> entityPaths, String value) async
+  {
+    await _updateMany(entityPaths, true, (Map<String, String> map, String baseName) {
+      map[baseName] = value;
+    });
+  }
+
+  // As setMany, but leaves entities which already have a value unchanged
+  Future<void> setManyIfAbsent(Iterable<String> entityPaths, String value) async
+  {
+    await _updateMany(entityPaths, true, (Map<String, String> map, String baseName) {
+      map.putIfAbsent(baseName, () => value);
+    });
+  }
+
+  // Removes many entities' values, reading & writing each directory's store file only once
+  Future<void> removeMany(Iterable<String> entityPaths) async
+  {
+    await _updateMany(entityPaths, false, (Map<String, String> map, String baseName) {
+      map.remove(baseName);
     });
   }
 
@@ -113,7 +205,7 @@ class EntityAttributesStore
       // set value
       map.remove(baseName);
       // save store file
-      await storeFile.writeAsString( json.encode(map) );
+      await _writeMapToFile(storeFile, map);
     });
   }
 }
@@ -0,0 +1,116 @@
+
+/** @fileoverview Per-route latency & upstream pool utilization of an HttpProxyServer */
+
+class _RouteMetrics
+{
+  int requestCount = 0;
+
+  int failedCount = 0;
+
+  int totalMicroseconds = 0;
+
+  int maxMicroseconds = 0;
+
+  void record(Duration latency, bool failed)
+  {
+    requestCount++;
+    if (failed) {
+      failedCount++;
+    }
+    totalMicroseconds += latency.inMicroseconds;
+    if (latency.inMicroseconds > maxMicroseconds) {
+      maxMicroseconds = latency.inMicroseconds;
+    }
+  }
+
+  Map<String, Object> toJson()
+  {
+    return {
+      "requests": requestCount,
+      "failed": failedCount,
+      "mean_ms": requestCount == 0 ? 0 : totalMicroseconds / requestCount / 1000,
+      "max_ms": maxMicroseconds / 1000
+    };
+  }
+}
+
+// past this many distinct routes, further routes are recorded together
+const int _MAX_ROUTES = 64;
+
+const String _OTHER_ROUTE = "other";
+
+class HttpProxyMetrics
+{
+  /** bound on upstream connections, requests beyond it wait for a pooled connection */
+  final int maxUpstreamConnections;
+
+  final Map<String, _RouteMetrics> _routes = {};
+
+  /** requests waiting for a pooled connection */
+  int _queuedUpstreamRequests = 0;
+
+  /** requests holding a pooled connection */
+  int _activeUpstreamRequests = 0;
+
+  int _peakActiveUpstreamRequests = 0;
+
+  /** requests refused for missing or rejected credentials, not recorded per route */
+  int _rejectedRequests = 0;
+
+  HttpProxyMetrics({required int this.maxUpstreamConnections});
+
+  void upstreamQueued()
+  {
+    _queuedUpstreamRequests++;
+  }
+
+  void upstreamDequeued()
+  {
+    _queuedUpstreamRequests--;
+  }
+
+  void upstreamConnected()
+  {
+    _activeUpstreamRequests++;
+    if (_activeUpstreamRequests > _peakActiveUpstreamRequests) {
+      _peakActiveUpstreamRequests = _activeUpstreamRequests;
+    }
+  }
+
+  void upstreamFinished()
+  {
+    _activeUpstreamRequests--;
+  }
+
+  /** @param route -- null when the target never verified the request's credentials (e.g. it was unreachable), recorded as "other" */
+  void recordRequest(String? route, Duration latency, bool failed)
+  {
+    if ( route == null || ( !_routes.containsKey(route) && _routes.length >= _MAX_ROUTES - 1 ) ) {
+      route = _OTHER_ROUTE; // one slot is kept for "other"
+    }
+    _routes.putIfAbsent(route, () => new _RouteMetrics()).record(latency, failed);
+  }
+
+  void recordRejectedRequest()
+  {
+    _rejectedRequests++;
+  }
+
+  Map<String, Object> toJson()
+  {
+    return {
+      "pool": {
+        "max_connections": maxUpstreamConnections,
+        "queued_requests": _queuedUpstreamRequests,
+        "active_requests": _activeUpstreamRequests,
+        "peak_active_requests": _peakActiveUpstreamRequests,
+        "utilization": _activeUpstreamRequests / maxUpstreamConnections
+      },
+      "rejected_requests": _rejectedRequests,
+      "routes": {
+        for (MapEntry<String, _RouteMetrics> entry in _routes.entries)
+          entry.key: entry.value.toJson()
+      }
+    };
+  }
+}
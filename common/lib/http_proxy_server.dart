@@ -1,15 +1,40 @@
 import "dart:io";
 import "dart:async";
-import "dart:typed_data";
+import "dart:convert";
 import "package:meta/meta.dart";
+import "package:common/http_proxy_metrics.dart";
+
+// request headers passed through to the target, so it can answer conditional & range requests
+const List<String> _FORWARDED_REQUEST_HEADERS = [
+  HttpHeaders.ifNoneMatchHeader,
+  HttpHeaders.ifModifiedSinceHeader,
+  HttpHeaders.rangeHeader,
+  "if-range"
+];
+
+// headers which apply to a single connection, never forwarded
+const Set<String> _HOP_BY_HOP_HEADERS = {
+  "connection", "keep-alive", "proxy-authenticate", "proxy-authorization",
+  "te", "trailers", "transfer-encoding", "upgrade"
+};
+
+class _UpstreamUnavailableException implements Exception
+{
+  @override
+  String toString()
+  {
+    return "No upstream connection became available in time";
+  }
+}
 
 abstract class HttpProxyServer
 {
   late HttpServer _server;
 
-  final Map<HttpRequest, HttpClientRequest> _activeRequests = {};
+  /** shared by all requests, so upstream connections are kept alive & reused */
+  late final HttpClient _client = _createPooledHttpClient();
 
-  final Map<HttpRequest, HttpClientResponse> _activeResponses = {};
+  late final HttpProxyMetrics metrics = new HttpProxyMetrics(maxUpstreamConnections: getMaxUpstreamConnections());
 
   @protected Future<HttpServer> bind();
 
@@ -18,6 +43,30 @@ abstract class HttpProxyServer
     return new HttpClient();
   }
 
+  /** upstream requests beyond this many wait for a pooled connection to free up */
+  @protected int getMaxUpstreamConnections()
+  {
+    return 32;
+  }
+
+  /** how long a request may wait for a pooled upstream connection before being answered 503 */
+  @protected Duration getUpstreamConnectionTimeout()
+  {
+    return const Duration(seconds: 10);
+  }
+
+  /** when set, metrics are served as JSON at this path, to loopback clients only (elsewhere the path is proxied as usual) */
+  @protected String? getMetricsPath()
+  {
+    return null;
+  }
+
+  /** latency is aggregated per route, which by default is the method & first two path segments (such as "GET /~/system") */
+  @protected String getRouteName(HttpRequest request)
+  {
+    return "${request.method} /${request.uri.pathSegments.take(2).join("/")}";
+  }
+
   @protected (Map<String, String>, bool) getTargetHeaders(HttpRequest request)
   {
     return (const {}, true);
@@ -51,6 +100,15 @@ abstract class HttpProxyServer
     );
   }
 
+  HttpClient _createPooledHttpClient()
+  {
+    HttpClient client = createHttpClient();
+    client.maxConnectionsPerHost = getMaxUpstreamConnections();
+    client.connectionTimeout = getUpstreamConnectionTimeout();
+    client.autoUncompress = false; // pass bodies through exactly as the target encoded them
+    return client;
+  }
+
   Future<void> start() async
   {
     try {
@@ -63,129 +121,209 @@ abstract class HttpProxyServer
       }
     }
     catch (e) {
-      _handleError(e);
+      print("${runtimeType} server error: ${e}");
     }
   }
   
   Future<void> _handleRequest(HttpRequest request) async
   {
+    Stopwatch stopwatch = new Stopwatch()..start();
+    // only set once the target has accepted the credentials (a parsed auth header alone proves nothing),
+    // so unauthenticated requests cannot add routes
+    String? route;
+    bool rejected = false;
+    bool failed = false;
     try {
 
       (Map<String, String>, bool) targetHeaders = getTargetHeaders(request);
 
       if (!targetHeaders.$2) {
         // end
+        rejected = true;
         await onComputeTargetHeadersFailed(request);
-        request.response.close();
+        await request.response.close();
+        return;
+      }
+
+      if ( request.uri.path == getMetricsPath() && request.connectionInfo?.remoteAddress.isLoopback == true ) {
+        route = getRouteName(request);
+        request.response.headers.contentType = ContentType.json;
+        request.response.write( json.encode( metrics.toJson() ) );
+        await request.response.close();
         return;
       }
 
-      // Create HTTP client
-      HttpClient client = createHttpClient();
+      if ( WebSocketTransformer.isUpgradeRequest(request) ) {
+        await _handleWebSocketRequest(request, targetHeaders.$1, () => route = getRouteName(request));
+        return;
+      }
 
-      // Build target URI
-      Uri targetUri = getTargetUri(request);
-      
-      // Create client request
-      HttpClientRequest clientRequest = await client.openUrl(
-        request.method,
-        targetUri
-      );
+      await _forwardRequest(request, targetHeaders.$1, (int statusCode) {
+        if (statusCode == HttpStatus.unauthorized) {
+          rejected = true;
+        }
+        else {
+          route = getRouteName(request);
+        }
+      });
+    }
+    catch (e) {
+      failed = true;
+      await _handleError(request, e);
+    }
+    finally {
+      if (rejected) {
+        metrics.recordRejectedRequest();
+      }
+      else {
+        metrics.recordRequest(route, stopwatch.elapsed, failed);
+      }
+    }
+  }
+
+  // onResponse is given the target's status, once it has answered
+  Future<void> _forwardRequest(HttpRequest request, Map<String, String> targetHeaders, void Function(int statusCode) onResponse) async
+  {
+    HttpClientRequest clientRequest = await _openUpstreamRequest(request);
+    metrics.upstreamConnected();
+    try {
 
-      for (MapEntry<String, String> entry in targetHeaders.$1.entries)
+      for (String name in _FORWARDED_REQUEST_HEADERS)
+      {
+        String? value = request.headers.value(name);
+        if (value != null) {
+          clientRequest.headers.set(name, value);
+        }
+      }
+
+      for (MapEntry<String, String> entry in targetHeaders.entries)
       {
         clientRequest.headers.set(entry.key, entry.value);
       }
-      
-      // Store active request for cleanup
-      _activeRequests[request] = clientRequest;
 
-      // Stream request body and wait for completion
-      await request.forEach((Uint8List data) {
-        clientRequest.add(data);
-      });
-      
+      if (request.contentLength >= 0) {
+        clientRequest.contentLength = request.contentLength;
+      }
+
+      // Pipe request body, pausing the inbound request while upstream is not keeping up
+      await clientRequest.addStream(request);
+
       // Get response
       HttpClientResponse clientResponse = await clientRequest.close();
-      _activeResponses[request] = clientResponse;
-      
+      onResponse(clientResponse.statusCode);
+
       // Handle response
       await _handleResponse(request, clientResponse);
-      
     }
     catch (e) {
-      _handleError(e);
-      try {
-        request.response.statusCode = 502;
-        request.response.close();
-      }
-      catch (_) {
+      clientRequest.abort(e); // don't return a half written connection to the pool
+      rethrow;
+    }
+    finally {
+      metrics.upstreamFinished();
+    }
+  }
 
-      }
+  // Creates the client request on a pooled connection, waiting at most getUpstreamConnectionTimeout() for one
+  Future<HttpClientRequest> _openUpstreamRequest(HttpRequest request) async
+  {
+    metrics.upstreamQueued();
+    Future<HttpClientRequest> opening = _client.openUrl(request.method, getTargetUri(request));
+    try {
+      return await opening.timeout(
+        getUpstreamConnectionTimeout(),
+        onTimeout: () {
+          // hand the connection straight back, should one free up after all
+          opening.then( (HttpClientRequest lateRequest) => lateRequest.abort(), onError: (Object e) {} );
+          throw new _UpstreamUnavailableException();
+        }
+      );
+    }
+    finally {
+      metrics.upstreamDequeued();
     }
   }
   
-  Future<void> _handleResponse(HttpRequest originalRequest, HttpClientResponse clientResponse) async
+  // Pipes a WebSocket through to the target, frame by frame, for as long as both ends stay open
+  // onConnected is called once the target has accepted the upgrade (& with it the credentials)
+  Future<void> _handleWebSocketRequest(HttpRequest request, Map<String, String> targetHeaders, void Function() onConnected) async
   {
+    // connect to the target first, so a failure can still be answered with 502
+    WebSocket targetSocket = await WebSocket.connect(
+      getTargetUri(request).replace(scheme: "ws").toString(),
+      headers: targetHeaders
+    );
+    onConnected();
+    WebSocket clientSocket;
     try {
-      // Set response status and headers
-      originalRequest.response.statusCode = clientResponse.statusCode;
-      originalRequest.response.reasonPhrase = clientResponse.reasonPhrase;
-    
-      // Forward response headers (excluding hop-by-hop headers)
-      final hopByHopHeaders = {
-        "connection", "keep-alive", "proxy-authenticate", "proxy-authorization",
-        "te", "trailers", "transfer-encoding", "upgrade"
-      };
-    
-      clientResponse.headers.forEach((name, values) {
-        if (!hopByHopHeaders.contains(name.toLowerCase())) {
-          originalRequest.response.headers.set(name, values);
-        }
-      });
-    
-      // Stream response body
-      await for (List<int> data in clientResponse)
-      {
-        originalRequest.response.add(data);
-      }
-    
-      // Close response
-      originalRequest.response.close();
-    
-      // Cleanup
-      _activeRequests.remove(originalRequest);
-      _activeResponses.remove(originalRequest);
-    
+      clientSocket = await WebSocketTransformer.upgrade(request);
     }
     catch (e) {
-      _handleError(e);
-      try {
-        originalRequest.response.statusCode = 502;
-        originalRequest.response.close();
-      }
-      catch (_) {
+      await targetSocket.close();
+      rethrow;
+    }
+
+    // addStream pauses each side while the other is backed up, & closing one side ends the other's stream in turn
+    // once upgraded there is no response left to report an error on, so errors only end the pipe
+    Future.wait([
+      targetSocket.addStream(clientSocket).whenComplete( () => targetSocket.close() ),
+      clientSocket.addStream(targetSocket).whenComplete( () => clientSocket.close() )
+    ]).then<void>( (List<void> _) {}, onError: (Object e) {} );
+  }
+
+  Future<void> _handleResponse(HttpRequest originalRequest, HttpClientResponse clientResponse) async
+  {
+    // Set response status and headers
+    originalRequest.response.statusCode = clientResponse.statusCode;
+    originalRequest.response.reasonPhrase = clientResponse.reasonPhrase;
 
+    // Forward response headers (excluding hop-by-hop headers)
+    clientResponse.headers.forEach((name, values) {
+      if (!_HOP_BY_HOP_HEADERS.contains(name.toLowerCase())) {
+        originalRequest.response.headers.set(name, values);
       }
-    }
+    });
+
+    // Write each chunk as it arrives (streamed command output must not sit in a buffer)
+    originalRequest.response.bufferOutput = false;
+
+    // Pipe response body, pausing upstream while the client is not keeping up
+    await originalRequest.response.addStream(clientResponse);
+
+    // Close response
+    await originalRequest.response.close();
   }
   
-  void _handleError(dynamic error)
-  {
-    print("HttpProxyServer handling error: $error");
-    
-    // Cleanup active requests on error
-    for (var request in _activeRequests.keys.toList())
-    {
-      try {
-        request.response.statusCode = 502;
-        request.response.close();
-      }
-      catch (_) {
+  // Fails only the request which errored, every other in flight request is unaffected
+  Future<void> _handleError(HttpRequest request, Object error) async
+  {
+    print("HttpProxyServer handling error for ${request.method} ${request.uri}: ${error}");
+    try {
+      request.response.statusCode =
+        error is _UpstreamUnavailableException ? HttpStatus.serviceUnavailable : HttpStatus.badGateway;
+    }
+    on StateError {
+      // headers already sent, closing would pass the truncated body off as complete
+      await _destroyConnection(request);
+      return;
+    }
+    try {
+      await request.response.close();
+    }
+    catch (_) {
+      await _destroyConnection(request);
+    }
+  }
 
-      }
+  // A response already started can only be failed by dropping the connection, so the client sees it is truncated
+  Future<void> _destroyConnection(HttpRequest request) async
+  {
+    try {
+      Socket socket = await request.response.detachSocket(writeHeaders: false);
+      socket.destroy();
+    }
+    catch (_) {
+      // connection already torn down by the failed write
     }
-    _activeRequests.clear();
-    _activeResponses.clear();
   }
 }
@@ -26,7 +26,10 @@ class UserExecutionClient
 
   UserExecutionClient(Map<String, String> this.environment);
 
-  /** Provides a stream of events as stdout/stderr is printed by the executable */
+  /** Provides a stream of events as stdout/stderr is printed by the executable
+   *
+   *  One request per execution: callers (shell.aot, run.aot) execute a single command per process, so a
+   *  session (as the terminal frame uses) would cost its upgrade without ever being reused. */
   Stream<UserExecutionClientResponse> execute(CommandLine commandLine) async*
   {
     String? authString = Platform.environment["AUTH_STRING"];
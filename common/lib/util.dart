@@ -56,12 +56,24 @@ bool pathContainsSpecialSegment(String path)
   return path.split("/").any(special_entity_path_segments.contains);
 }
 
+// the absolute glob pattern (within the file system source path) for an entity expression
+String getGlobPatternFromExpression(String expression)
+{
+  return (file_system_source_path + "/" + expression).replaceAll("//", "/");
+}
+
+// the entity path for a path within the file system source path
+String getEntityPathFromSourcePath(String sourcePath)
+{
+  return ("/" + sourcePath.substring(file_system_source_path.length) ).replaceAll("//", "/");
+}
+
 Future< List<String> > getEntityPathsFromExpression(String expression) async
 {
   return
-    ( new Glob( (file_system_source_path + "/" + expression).replaceAll("//", "/") ).list() )
+    ( new Glob( getGlobPatternFromExpression(expression) ).list() )
     .where( (FileSystemEntity e) => e is File )
     .where( (FileSystemEntity e) => !pathContainsSpecialSegment(e.path) ) // no special segment containing matched
-    .map( (FileSystemEntity e) => ("/" + e.path.substring(file_system_source_path.length).replaceAll("//", "/") ) )
+    .map( (FileSystemEntity e) => getEntityPathFromSourcePath(e.path) )
     .toList();
 }
@@ -29,7 +29,7 @@ class ExecuteAs
       return Process.start(
         commandLine.command,
         commandLine.arguments,
-        environment: {...environment, ...commandLine.environmentOverrides},
+        environment: {...environment, ...commandLine.environmentOverrides, USER_ACCESS_PRIVILEGE_ENV_VAR: privilege.name},
         workingDirectory: safeJoinPaths(mountPointForPrivilegeLevel, workingDirectory)
       );
     }
@@ -61,6 +61,12 @@ class ExecuteAs
   static Future<Process> executeAsUser(String authString, CommandLine commandLine, Map<String, String> environment) async
   {
     User user = UserListAccessor.getUserFromAuthString(authString);
+    return executeAsVerifiedUser(user, authString, commandLine, environment);
+  }
+
+  // For callers which already resolved the user from the auth string (such as a session)
+  static Future<Process> executeAsVerifiedUser(User user, String authString, CommandLine commandLine, Map<String, String> environment)
+  {
     return executeAsPrivilegeLevel(user.privilege, commandLine, {...environment, "AUTH_STRING": authString});
   }
 
@@ -70,4 +76,18 @@ class ExecuteAs
     User user = UserListAccessor.getUserFromAuthString(authString);
     return new File( safeJoinPaths(_getMountPointFromPrivilegeLevel(user.privilege), path) );
   }
+
+  // The file system does not report modification times, so these are read from the source entity
+  static Future<DateTime> getFileLastModified(String path) async
+  {
+    return ( await new File( safeJoinPaths(file_system_source_path, path) ).stat() ).modified;
+  }
+
+  // Strong ETag of the file as seen by the user -- changes with the file, or with what the user may see of it
+  static Future<String> getFileETagAsUser(String authString, String path, int length, DateTime lastModified) async
+  {
+    User user = UserListAccessor.getUserFromAuthString(authString);
+    String accessLevel = await entityAccessLevelStore.get(path, DEFAULT_ENTITY_ACCESS_LEVEL.name);
+    return "\"${user.privilege.name}-${accessLevel}-${length}-${lastModified.millisecondsSinceEpoch}\"";
+  }
 }
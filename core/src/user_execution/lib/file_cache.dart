@@ -0,0 +1,73 @@
+import "dart:collection";
+import "dart:typed_data";
+
+/** @fileoverview In-memory cache of small, frequently read files (such as the frames' assets)
+ *
+ *    Entries are keyed by the file's path within the privilege level's mount point, and by its ETag
+ *    (which captures privilege, access level, size & modification time), so a changed file is never served stale.
+ * */
+
+class _FileCacheEntry
+{
+  final String etag;
+
+  final Uint8List bytes;
+
+  _FileCacheEntry(String this.etag, Uint8List this.bytes);
+}
+
+class FileCache
+{
+  /** files larger than this are always streamed, never cached */
+  final int maxEntryBytes;
+
+  /** least recently used entries are evicted past this */
+  final int maxTotalBytes;
+
+  // iteration order is least recently used first
+  final LinkedHashMap<String, _FileCacheEntry> _entries = new LinkedHashMap<String, _FileCacheEntry>();
+
+  int _totalBytes = 0;
+
+  FileCache({
+    required int this.maxEntryBytes,
+    required int this.maxTotalBytes
+  });
+
+  bool canCache(int length)
+  {
+    return length <= maxEntryBytes;
+  }
+
+  Uint8List? get(String path, String etag)
+  {
+    _FileCacheEntry? entry = _entries.remove(path);
+    if (entry == null) {
+      return null;
+    }
+    if (entry.etag != etag) {
+      _totalBytes -= entry.bytes.length; // stale, drop
+      return null;
+    }
+    _entries[path] = entry; // re-insert as most recently used
+    return entry.bytes;
+  }
+
+  void put(String path, String etag, Uint8List bytes)
+  {
+    if ( !canCache(bytes.length) ) {
+      return;
+    }
+    _FileCacheEntry? previous = _entries.remove(path);
+    if (previous != null) {
+      _totalBytes -= previous.bytes.length;
+    }
+    _entries[path] = new _FileCacheEntry(etag, bytes);
+    _totalBytes += bytes.length;
+    while (_totalBytes > maxTotalBytes)
+    {
+      String leastRecentlyUsedPath = _entries.keys.first;
+      _totalBytes -= _entries.remove(leastRecentlyUsedPath)!.bytes.length;
+    }
+  }
+}
@@ -1,11 +1,16 @@
 import "dart:convert";
 import "dart:io";
+import "dart:math";
+import "dart:typed_data";
 import "package:mime/mime.dart";
 import "package:common/http_request_extension.dart";
 import "package:common/executable.dart";
 import "package:common/constants/user_execution_service_port.dart";
+import "package:common/constants/user_execution_session_path.dart";
 import "package:mutex/mutex.dart";
 import "package:user_execution/execute_as.dart";
+import "package:user_execution/file_cache.dart";
+import "package:user_execution/user_execution_session.dart";
 import "package:user_execution/user_list_accessor.dart";
 
 /** @fileoverview Executes commands under the privilege level of the current user
@@ -34,8 +39,87 @@ class _StdOutputHandler
   }
 }
 
+// a single byte range of a file, end exclusive
+class _ByteRange
+{
+  final int start;
+
+  final int end;
+
+  _ByteRange(int this.start, int this.end);
+
+  int get length => end - start;
+
+  bool get isSatisfiable => start < end;
+
+  /** Parses the Range header against the file's length
+   *  @return null if the whole file should be sent (no header, malformed, or multiple ranges -- which are not supported) */
+  static _ByteRange? parse(String? header, int fileLength)
+  {
+    const String unitPrefix = "bytes=";
+    if ( header == null || !header.startsWith(unitPrefix) || header.contains(",") ) {
+      return null;
+    }
+    List<String> bounds = header.substring(unitPrefix.length).trim().split("-");
+    if (bounds.length != 2) {
+      return null;
+    }
+    int? first = int.tryParse(bounds[0]);
+    int? last = int.tryParse(bounds[1]);
+    if (first == null) {
+      // suffix range, "bytes=-n" is the last n bytes
+      if (last == null) {
+        return null;
+      }
+      return new _ByteRange( max(0, fileLength - last), last == 0 ? 0 : fileLength );
+    }
+    if (first >= fileLength) {
+      return new _ByteRange(fileLength, fileLength); // unsatisfiable
+    }
+    if (last != null && last < first) {
+      return null;
+    }
+    return new _ByteRange( first, last == null ? fileLength : min(last + 1, fileLength) );
+  }
+}
+
 class _UserExecutionService
 {
+  /** optional, serves small hot files (frame assets) from memory */
+  final FileCache? fileCache;
+
+  _UserExecutionService({FileCache? this.fileCache});
+
+  bool _etagListMatches(String? header, String etag)
+  {
+    if (header == null) {
+      return false;
+    }
+    return header.split(",").map( (String e) => e.trim() ).any( (String e) => e == "*" || e == etag || e == "W/${etag}" );
+  }
+
+  bool _isNotModified(HttpRequest request, String etag, DateTime lastModified)
+  {
+    String? ifNoneMatch = request.headers.value(HttpHeaders.ifNoneMatchHeader);
+    if (ifNoneMatch != null) {
+      return _etagListMatches(ifNoneMatch, etag); // takes precedence over If-Modified-Since
+    }
+    DateTime? ifModifiedSince = request.headers.ifModifiedSince;
+    // HTTP dates have a resolution of seconds
+    return ifModifiedSince != null &&
+           lastModified.millisecondsSinceEpoch ~/ 1000 <= ifModifiedSince.millisecondsSinceEpoch ~/ 1000;
+  }
+
+  // Range is only honoured if If-Range (when sent) still matches the current file
+  _ByteRange? _getRequestedRange(HttpRequest request, String etag, int length)
+  {
+    String? ifRange = request.headers.value("if-range");
+    if (ifRange != null && ifRange != etag) {
+      return null;
+    }
+    return _ByteRange.parse(request.headers.value(HttpHeaders.rangeHeader), length);
+  }
+
   Future<void> _handleReadFileAsUser(HttpRequest request, String path, String authString) async
   {
     File file = ExecuteAs.getFileAsUser(authString, path);
@@ -45,6 +129,21 @@ class _UserExecutionService
       request.response.statusCode = HttpStatus.notFound;
       return;
     }
+
+    int length = await file.length();
+    DateTime lastModified = await ExecuteAs.getFileLastModified(path);
+    String etag = await ExecuteAs.getFileETagAsUser(authString, path, length, lastModified);
+
+    // Validators, so the frames only re-download what changed
+    request.response.headers.set(HttpHeaders.etagHeader, etag);
+    request.response.headers.set(HttpHeaders.lastModifiedHeader, HttpDate.format(lastModified));
+    request.response.headers.set(HttpHeaders.cacheControlHeader, "no-cache"); // always revalidate, access levels can change
+    request.response.headers.set(HttpHeaders.acceptRangesHeader, "bytes");
+
+    if ( _isNotModified(request, etag, lastModified) ) {
+      request.response.statusCode = HttpStatus.notModified;
+      return;
+    }
     
     // Use file extension to determine MIME type
     String? mimeType = lookupMimeType(request.uri.path);
@@ -57,10 +156,53 @@ class _UserExecutionService
       // Default to application/octet-stream for unknown types
       request.response.headers.contentType = ContentType.binary;
     }
-    
-    // Read and send file content
-    List<int> fileBytes = await file.readAsBytes();
-    request.response.add(fileBytes);
+
+    // HEAD needs only the headers, the file is not read
+    bool isHead = request.method == "HEAD";
+    _ByteRange? range = _getRequestedRange(request, etag, length);
+    if (range != null) {
+      if (!range.isSatisfiable) {
+        request.response.statusCode = HttpStatus.requestedRangeNotSatisfiable;
+        request.response.headers.set(HttpHeaders.contentRangeHeader, "bytes */${length}");
+        return;
+      }
+      request.response.statusCode = HttpStatus.partialContent;
+      request.response.headers.set(HttpHeaders.contentRangeHeader, "bytes ${range.start}-${range.end - 1}/${length}");
+      request.response.contentLength = range.length;
+      if (isHead) {
+        return;
+      }
+      await request.response.addStream( file.openRead(range.start, range.end) );
+      return;
+    }
+
+    request.response.contentLength = length;
+    if (isHead) {
+      return;
+    }
+
+    // Serve small files from memory when cached
+    if ( fileCache != null && fileCache!.canCache(length) ) {
+      Uint8List? bytes = fileCache!.get(file.path, etag);
+      if (bytes == null) {
+        // bounded to the length already sent, a file growing meanwhile is cut off (and not cached)
+        BytesBuilder builder = new BytesBuilder(copy: false);
+        await for (List<int> chunk in file.openRead(0, length))
+        {
+          builder.add(chunk);
+        }
+        bytes = builder.takeBytes();
+        if (bytes.length == length) {
+          fileCache!.put(file.path, etag, bytes);
+        }
+      }
+      request.response.add(bytes);
+      return;
+    }
+
+    // Stream file content, rather than holding it all in memory
+    // bounded to the length already sent, so a file growing meanwhile cannot overrun Content-Length
+    await request.response.addStream( file.openRead(0, length) );
   }
 
   void _setChunkStreamingHeaders(HttpRequest request)
@@ -125,6 +267,18 @@ class _UserExecutionService
     await _respondWithExitCode(request, process);
   }
 
+  bool _isSessionRequest(HttpRequest request)
+  {
+    return request.uri.path == user_execution_session_path && WebSocketTransformer.isUpgradeRequest(request);
+  }
+
+  // Authenticated once here, the session then owns the connection
+  Future<void> _handleSession(HttpRequest request, String authString) async
+  {
+    WebSocket socket = await WebSocketTransformer.upgrade(request);
+    new UserExecutionSessionHandler(socket, UserListAccessor.getUserFromAuthString(authString), authString).run();
+  }
+
   Future<void> _routeRequest(HttpRequest request, String authString) async
   {
     String path = request.uri.path;
@@ -136,6 +290,7 @@ class _UserExecutionService
     switch (request.method)
     {
       case "GET":
+      case "HEAD": // body is discarded by HttpResponse for HEAD
         // Get a file as the current user (used by terminal.aot for loading frames)
         await _handleReadFileAsUser(request, path, authString);
         break;
@@ -164,6 +319,10 @@ class _UserExecutionService
       // get auth string passed through as HTTP auth header.
       String? authString = request.headers.value(HttpHeaders.authorizationHeader);
       if ( await _preverifyAuthString(authString) ) {
+        if ( _isSessionRequest(request) ) {
+          await _handleSession(request, authString!);
+          return;
+        }
         await _routeRequest(request, authString!);
       }
       else {
@@ -177,17 +336,46 @@ class _UserExecutionService
       print(request.uri);
       print(e);
       print(s);
-      request.response.statusCode = HttpStatus.badRequest;
-      request.response.writeln("User execution service unhandled exception:");
-      request.response.writeln(e);
-      await request.response.close(); // close automatically calls flush
+      try {
+        request.response.statusCode = HttpStatus.badRequest;
+      }
+      on StateError {
+        // headers already sent (e.g. the file shrank while streaming), so the status can no longer change
+        await _destroyConnection(request);
+        return;
+      }
+      try {
+        request.response.writeln("User execution service unhandled exception:");
+        request.response.writeln(e);
+        await request.response.close(); // close automatically calls flush
+      }
+      catch (_) {
+        await _destroyConnection(request);
+      }
+    }
+  }
+
+  // A response already started can only be failed by dropping the connection, so the client sees it is truncated
+  Future<void> _destroyConnection(HttpRequest request) async
+  {
+    try {
+      Socket socket = await request.response.detachSocket(writeHeaders: false);
+      socket.destroy();
+    }
+    catch (_) {
+      // connection already torn down by the failed write
     }
   }
 }
 
 Future<void> main(List<String> arguments) async
 {
-  _UserExecutionService service = new _UserExecutionService();
+  _UserExecutionService service = new _UserExecutionService(
+    fileCache: new FileCache(
+      maxEntryBytes: 256 * 1024,
+      maxTotalBytes: 32 * 1024 * 1024
+    )
+  );
 
   // Bind a ServerSocket on special port for user execution service
   HttpServer server = await HttpServer.bind(InternetAddress.loopbackIPv4, user_execution_service_port);
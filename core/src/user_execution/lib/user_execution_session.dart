@@ -0,0 +1,142 @@
+import "dart:convert";
+import "dart:io";
+import "package:common/executable.dart";
+import "package:user_execution/execute_as.dart";
+import "package:user_execution/user.dart";
+
+/** @fileoverview A long-lived session between a client (such as the terminal frame) & the user execution service
+ *
+ *    The user is authenticated once, when the session's WebSocket is opened.
+ *    Many command executions are multiplexed over the one socket, each tagged by a client chosen id.
+ *
+ *    Client -> service frames:
+ *      {"type": "environment", "set": {...}, "unset": [...]}  -- delta applied to the session's environment
+ *      {"type": "execute", "id": 1, "command": "...", "arguments": [...]}  -- runs with the environment as of now
+ *      {"type": "kill", "id": 1}
+ *
+ *    Service -> client frames, the same chunks as the POST endpoint's NDJSON, plus the id:
+ *      {"id": 1, "stdout": "..."} / {"id": 1, "stderr": "..."} / {"id": 1, "exit_code": 0} / {"id": 1, "error": "..."}
+ * */
+
+class UserExecutionSessionHandler
+{
+  final WebSocket _socket;
+
+  final User _user;
+
+  final String _authString;
+
+  final Map<String, String> _environment = {};
+
+  // null while the execution is still starting
+  final Map<int, Process?> _processes = {};
+
+  // executions killed while still starting, killed as soon as they start
+  final Set<int> _killRequested = {};
+
+  bool _closed = false;
+
+  UserExecutionSessionHandler(WebSocket this._socket, User this._user, String this._authString);
+
+  void _send(Map<String, Object?> frame)
+  {
+    if (_socket.closeCode == null) {
+      _socket.add( json.encode(frame) );
+    }
+  }
+
+  void _applyEnvironmentDelta(Map<String, dynamic> frame)
+  {
+    _environment.addAll( ( frame["set"] as Map? ?? const {} ).cast<String, String>() );
+    for (String name in ( frame["unset"] as List? ?? const [] ).cast<String>() )
+    {
+      _environment.remove(name);
+    }
+  }
+
+  Future<void> _execute(int id, CommandLine commandLine, Map<String, String> environment) async
+  {
+    // registered before starting, so a kill or the session closing meanwhile is not missed
+    _processes[id] = null;
+    try {
+      Process process = await ExecuteAs.executeAsVerifiedUser(_user, _authString, commandLine, environment);
+      _processes[id] = process;
+      if ( _closed || _killRequested.contains(id) ) {
+        process.kill();
+      }
+
+      Future<void> stdoutDone = process.stdout.transform(utf8.decoder).listen(
+        (String data) => _send({"id": id, "stdout": data})
+      ).asFuture();
+      Future<void> stderrDone = process.stderr.transform(utf8.decoder).listen(
+        (String data) => _send({"id": id, "stderr": data})
+      ).asFuture();
+      await Future.wait([stdoutDone, stderrDone]);
+
+      _send({"id": id, "exit_code": await process.exitCode});
+    }
+    catch (e) {
+      _send({"id": id, "error": e.toString()});
+    }
+    finally {
+      _processes.remove(id);
+      _killRequested.remove(id);
+    }
+  }
+
+  void _handleFrame(Map<String, dynamic> frame)
+  {
+    switch (frame["type"])
+    {
+      case "environment":
+        _applyEnvironmentDelta(frame);
+        break;
+      case "execute":
+        CommandLine commandLine = new CommandLine(
+          command: frame["command"] as String,
+          arguments: ( frame["arguments"] as List ).cast<String>()
+        );
+        // snapshot the environment now, later deltas apply only to later executions
+        _execute(frame["id"] as int, commandLine, {..._environment});
+        break;
+      case "kill":
+        int id = frame["id"] as int;
+        if ( !_processes.containsKey(id) ) {
+          break; // unknown, or already exited
+        }
+        if (_processes[id] == null) {
+          _killRequested.add(id);
+        }
+        else {
+          _processes[id]!.kill();
+        }
+        break;
+      default:
+        throw new Exception("Unknown session frame type: ${frame["type"]}");
+    }
+  }
+
+  Future<void> run() async
+  {
+    try {
+      await for (dynamic message in _socket)
+      {
+        _handleFrame( json.decode(message as String) as Map<String, dynamic> );
+      }
+    }
+    catch (e, s) {
+      print("User execution session closed on exception:");
+      print(e);
+      print(s);
+      await _socket.close(WebSocketStatus.protocolError);
+    }
+    finally {
+      // nothing left to stream output to, executions still starting are killed once they start
+      _closed = true;
+      for (Process? process in _processes.values)
+      {
+        process?.kill();
+      }
+    }
+  }
+}
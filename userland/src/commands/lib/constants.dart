@@ -4,3 +4,6 @@
 const String SUPER_FRAME_PATH = "/~/system/frames/frame_manager";
 
 const int TERMINAL_PORT = 80;
+
+// Path at which terminal.aot serves its proxy's latency & connection pool metrics (JSON), to loopback clients only
+const String PROXY_METRICS_PATH = "/proxy_metrics";
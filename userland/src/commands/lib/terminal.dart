@@ -74,6 +74,12 @@ class _TerminalService extends HttpProxyServer
     request.response.write("Authentication required");
   }
 
+  @override
+  @protected String? getMetricsPath()
+  {
+    return PROXY_METRICS_PATH;
+  }
+
   @override
   @protected int getTargetPort()
   {
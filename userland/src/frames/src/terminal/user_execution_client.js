@@ -40,21 +40,127 @@ async function* _streamExecuteResponseLines(response)
   }
 }
 
-// generator that yields a series of these objects::
-// {"stdout": "string", "stderr": "string", "exit_code": 0}
-async function* execute(command, parameters, environment)
+// path of the user execution service's session endpoint (see user_execution_session_path.dart)
+const USER_EXECUTION_SESSION_PATH = "/session";
+
+// A persistent WebSocket session with the user execution service, shared by all executions from this frame.
+// Authenticates once on open, sends the environment as deltas, and multiplexes executions by id.
+class _UserExecutionSession
 {
-  // runtime type checking is such fun
-  if (command == null) {
-    throw new Error("command is required");
+  constructor(socket)
+  {
+    this._socket = socket;
+    this._executions = new Map(); // id -> {chunks, wake}
+    this._environment = {}; // the environment as the service holds it for this session
+    this._nextId = 0;
+    this.closed = false;
+    socket.onmessage = (event) => this._onMessage( JSON.parse(event.data) );
+    socket.onclose = () => this._onClose();
   }
-  if (parameters == null) {
-    throw new Error("parameters is required");
+
+  static open()
+  {
+    const url = new URL(USER_EXECUTION_SESSION_PATH, location.href);
+    url.protocol = location.protocol === "https:" ? "wss:" : "ws:";
+    return new Promise( (resolve, reject) => {
+      const socket = new WebSocket(url);
+      socket.onopen = () => resolve( new _UserExecutionSession(socket) );
+      socket.onerror = () => reject( new Error("user execution session failed to open") );
+    });
   }
-  if (environment == null) {
-    throw new Error("environment is required");
+
+  _sendEnvironmentDelta(environment)
+  {
+    const set = {};
+    for (const [name, value] of Object.entries(environment))
+    {
+      if (this._environment[name] !== value) {
+        set[name] = value;
+      }
+    }
+    const unset = Object.keys(this._environment).filter( (name) => !(name in environment) );
+    if (Object.keys(set).length === 0 && unset.length === 0) {
+      return;
+    }
+    this._socket.send( JSON.stringify({type: "environment", set: set, unset: unset}) );
+    this._environment = {...environment};
   }
 
+  _wake(execution)
+  {
+    if (execution.wake != null) {
+      execution.wake();
+      execution.wake = null;
+    }
+  }
+
+  _onMessage(chunk)
+  {
+    const execution = this._executions.get(chunk.id);
+    if (execution != null) {
+      execution.chunks.push(chunk);
+      this._wake(execution);
+    }
+  }
+
+  _onClose()
+  {
+    this.closed = true;
+    for (const execution of this._executions.values())
+    {
+      execution.chunks.push({error: "user execution session closed before command exited"});
+      this._wake(execution);
+    }
+  }
+
+  async* execute(command, parameters, environment)
+  {
+    const id = this._nextId++;
+    const execution = {chunks: [], wake: null};
+    this._executions.set(id, execution);
+    try {
+      this._sendEnvironmentDelta(environment);
+      this._socket.send( JSON.stringify({type: "execute", id: id, command: command, arguments: parameters}) );
+      while (true)
+      {
+        if (execution.chunks.length === 0) {
+          await new Promise( (resolve) => execution.wake = resolve );
+          continue;
+        }
+        const chunk = execution.chunks.shift();
+        if (chunk.error != null) {
+          throw new Error(chunk.error);
+        }
+        yield chunk;
+        if (chunk.exit_code != null) {
+          break;
+        }
+      }
+    }
+    finally {
+      this._executions.delete(id);
+    }
+  }
+}
+
+let _sessionPromise = null;
+
+// resolves to the open session (reopening a closed one), or null if one cannot be opened
+async function _getSession()
+{
+  if (_sessionPromise != null) {
+    const session = await _sessionPromise;
+    if (session != null && !session.closed) {
+      return session;
+    }
+  }
+  _sessionPromise = _UserExecutionSession.open().catch( () => null );
+  return _sessionPromise;
+}
+
+// one request per execution, used when no session can be opened
+async function* _executeOverRequest(command, parameters, environment)
+{
   const response = await fetch(
     "/~" + command + "?" + new URLSearchParams(environment).toString(),
     {
@@ -68,6 +174,30 @@ async function* execute(command, parameters, environment)
   }
 }
 
+// generator that yields a series of these objects::
+// {"stdout": "string", "stderr": "string", "exit_code": 0}
+async function* execute(command, parameters, environment)
+{
+  // runtime type checking is such fun
+  if (command == null) {
+    throw new Error("command is required");
+  }
+  if (parameters == null) {
+    throw new Error("parameters is required");
+  }
+  if (environment == null) {
+    throw new Error("environment is required");
+  }
+
+  const session = await _getSession();
+  if (session != null) {
+    yield* session.execute(command, parameters, environment);
+  }
+  else {
+    yield* _executeOverRequest(command, parameters, environment);
+  }
+}
+
 function _pushOutput(result, chunk, key)
 {
   if (chunk[key] != null) {
@@ -2,23 +2,27 @@ import "dart:io";
 import "package:path/path.dart" as path_util;
 import "package:common/util.dart";
 import "package:common/access_types.dart";
+import "package:common/bulk_entity_attributes.dart";
 import "package:common/entity_attributes_stores.dart";
 
 /** @fileoverview Tool used to set access level of files from init */
 
 // TODO is largely duplicate with set_access.dart in core
 
-Future<void> _handleSetAccess(List<String> entityPaths, String accessLevelArgument) async
+Future<void> _handleSetAccess(String expression, String accessLevelArgument, bool dryRun) async
 {
   EntityAccessLevel accessLevel = EntityAccessLevel.values.byName(accessLevelArgument);
-  stdout.write("Updating ${entityPaths.length} entities to ${accessLevel.name} access... ");
+  stdout.writeln("Updating matching entities to ${accessLevel.name} access${dryRun ? " (dry run)" : ""}...");
   await stdout.flush();
   DateTime started = new DateTime.now();
-  for (String entityPath in entityPaths)
-  {
-    await entityAccessLevelStore.set(entityPath, accessLevel.name);
-  }
-  stdout.writeln("done after ${new DateTime.now().difference(started).inMilliseconds}ms");
+  BulkSetProgress progress = await bulkSetEntityAttribute(
+    entityAccessLevelStore,
+    expression,
+    accessLevel.name,
+    dryRun: dryRun,
+    onProgress: (BulkSetProgress progress) => stdout.writeln("${progress} so far...")
+  );
+  stdout.writeln( describeBulkSetResult(progress, dryRun, new DateTime.now().difference(started)) );
   await stdout.flush();
 }
 
@@ -38,7 +42,7 @@ Future<void> _handleShowAccess(List<String> entityPaths) async
 void _printHelpAndExit()
 {
   print("Bad arguments to access");
-  print("Usage: access show|set path [value]");
+  print("Usage: access show|set path [value] [--dry-run]");
   exit(1);
 }
 
@@ -48,14 +52,17 @@ Future<void> main(List<String> arguments) async
     _printHelpAndExit();
   }
   String command = arguments[0];
-  List<String> entityPaths = await getEntityPathsFromExpression(arguments[1]);
   switch (command)
   {
     case "set":
+      if (arguments.length < 3) {
+        _printHelpAndExit();
+      }
       String accessLevelArgument = arguments[2];
-      return _handleSetAccess(entityPaths, accessLevelArgument);
+      bool dryRun = arguments.contains("--dry-run");
+      return _handleSetAccess(arguments[1], accessLevelArgument, dryRun);
     case "show":
-      return _handleShowAccess(entityPaths);
+      return _handleShowAccess( await getEntityPathsFromExpression(arguments[1]) );
     default:
       _printHelpAndExit();
   }
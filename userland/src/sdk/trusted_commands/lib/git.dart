@@ -1,6 +1,9 @@
 import "dart:io";
 import "package:mutex/mutex.dart";
+import "package:path/path.dart" as path_util;
+import "package:common/access_types.dart";
 import "package:common/constants/file_system_source_path.dart";
+import "package:common/entity_attributes_stores.dart";
 import "package:common/util.dart";
 import "package:trusted_commands/trusted_command_wrapper.dart";
 
@@ -8,6 +11,8 @@ import "package:trusted_commands/trusted_command_wrapper.dart";
 
 const String _GIT_SECRET_ACCESS = "git token here";
 
+const String _GIT_EXECUTABLE = "/usr/bin/git";
+
 enum _GitCommand
 {
   branch,
@@ -89,11 +94,10 @@ class _GitWrapper extends TrustedCommandWrapper<_GitCommand>
   {
     String cwd = Platform.environment["CWD"]!;
 
-    const String gitExecutable = "/usr/bin/git";
     final List<String> gitArguments = _getFinalArguments(command, args);
 
     final String fullGitCommand = [
-      gitExecutable,
+      _GIT_EXECUTABLE,
       ...gitArguments
     ].map(_quoteForShell).join(' ');
 
@@ -118,6 +122,129 @@ class _GitWrapper extends TrustedCommandWrapper<_GitCommand>
       workingDirectory: safeJoinPaths(file_system_source_path, cwd)
     );
   }
+
+  // commands which replace files in the source tree behind the file system
+  bool _changesWorkingTree(_GitCommand command)
+  {
+    return command == _GitCommand.clone ||
+           command == _GitCommand.checkout ||
+           command == _GitCommand.$switch ||
+           command == _GitCommand.pull;
+  }
+
+  Future<String?> _runGitForOutput(String workingDirectory, List<String> arguments) async
+  {
+    ProcessResult result = await Process.run(_GIT_EXECUTABLE, arguments, workingDirectory: workingDirectory);
+    if (result.exitCode != 0) {
+      return null;
+    }
+    return result.stdout as String;
+  }
+
+  Future<String?> _readHead(String repositoryPath) async
+  {
+    return ( await _runGitForOutput(repositoryPath, ["rev-parse", "--verify", "-q", "HEAD"]) )?.trim();
+  }
+
+  // the top level of the work tree, within the file system source path
+  Future<String?> _getRepositoryPath(_GitCommand command, List<String> args) async
+  {
+    if (command == _GitCommand.clone) {
+      return _getGitCloneArguments(args)[1];
+    }
+    String cwd = Platform.environment["CWD"]!;
+    return ( await _runGitForOutput(safeJoinPaths(file_system_source_path, cwd), ["rev-parse", "--show-toplevel"]) )?.trim();
+  }
+
+  List<String> _splitNulSeparated(String? output)
+  {
+    return (output ?? "").split("\u0000").where( (String p) => p.isNotEmpty ).toList();
+  }
+
+  /** @return paths relative to the repository, of files added between the two commits, and of every file
+   *  added, modified or deleted between them (or all files for both, if no old commit) */
+  Future<(List<String>, List<String>)> _getChangedPaths(String repositoryPath, String? oldHead, String newHead) async
+  {
+    if (oldHead == null) {
+      List<String> paths = _splitNulSeparated( await _runGitForOutput(repositoryPath, ["ls-tree", "-r", "-z", "--name-only", newHead]) );
+      return (paths, paths);
+    }
+    // -z output alternates status and path: "A\0path\0M\0path\0..."
+    String? output = await _runGitForOutput(repositoryPath, ["diff-tree", "-r", "-z", "--no-renames", "--name-status", oldHead, newHead]);
+    List<String> fields = (output ?? "").split("\u0000");
+    List<String> addedPaths = <String>[];
+    List<String> changedPaths = <String>[];
+    for (int i = 0; i + 1 < fields.length; i += 2)
+    {
+      if (fields[i] == "A") {
+        addedPaths.add(fields[i + 1]);
+      }
+      changedPaths.add(fields[i + 1]);
+    }
+    return (addedPaths, changedPaths);
+  }
+
+  /** For a path checkout (git checkout [<rev>] -- <pathspec>...), which rewrites files without moving HEAD
+   *  @return paths relative to the repository, of files under the pathspecs which are in the index but not in the commit,
+   *  and of every file under the pathspecs */
+  Future<(List<String>, List<String>)> _getCheckedOutPaths(String workingDirectory, String head, List<String> pathspecs) async
+  {
+    List<String> addedPaths = _splitNulSeparated(
+      await _runGitForOutput(workingDirectory, ["diff", "--cached", "-z", "--no-renames", "--name-only", "--diff-filter=A", head, "--", ...pathspecs])
+    );
+    List<String> changedPaths = _splitNulSeparated(
+      await _runGitForOutput(workingDirectory, ["ls-files", "-z", "--full-name", "--", ...pathspecs])
+    );
+    return (addedPaths, changedPaths);
+  }
+
+  List<String> _toEntityPaths(String repositoryPath, List<String> paths)
+  {
+    return paths
+      .map( (String p) => getEntityPathFromSourcePath( path_util.join(repositoryPath, p) ) )
+      .where( (String p) => !pathContainsSpecialSegment(p) )
+      .toList();
+  }
+
+  // git writes to the source tree directly (not through the file system), so mirror what the file system does on create & write:
+  // new files get an initial access level (unless they already have one), & any rewritten file loses its trusted executable bit
+  Future<void> _reconcileChangedFiles(_GitCommand command, List<String> args, String repositoryPath, String? oldHead) async
+  {
+    String? newHead = await _readHead(repositoryPath);
+    if (newHead == null) {
+      return;
+    }
+    (List<String>, List<String>) changes;
+    int pathspecsIndex = args.indexOf("--");
+    if (newHead != oldHead) {
+      changes = await _getChangedPaths(repositoryPath, oldHead, newHead);
+    }
+    else if (command == _GitCommand.checkout && pathspecsIndex != -1 && pathspecsIndex + 1 < args.length) {
+      String workingDirectory = safeJoinPaths(file_system_source_path, Platform.environment["CWD"]!);
+      changes = await _getCheckedOutPaths(workingDirectory, newHead, args.sublist(pathspecsIndex + 1));
+    }
+    else {
+      return; // HEAD did not move & no paths were checked out, nothing rewritten
+    }
+    await entityAccessLevelStore.setManyIfAbsent( _toEntityPaths(repositoryPath, changes.$1), STANDARD_ACCESS_CREATED_FILE_INITIAL_ACCESS_LEVEL.name );
+    await trustedExecutablesStore.removeMany( _toEntityPaths(repositoryPath, changes.$2) );
+  }
+
+  @override
+  Future<void> run(_GitCommand command, List<String> args) async
+  {
+    // as with the file system, only files created or written by a standard user are reconciled
+    bool isStandardUser = Platform.environment[USER_ACCESS_PRIVILEGE_ENV_VAR] == UserAccessPrivilege.standard.name;
+    if ( !isStandardUser || !_changesWorkingTree(command) ) {
+      return super.run(command, args);
+    }
+    String? repositoryPath = await _getRepositoryPath(command, _transformArgsToTokenUrl(args));
+    String? oldHead = repositoryPath == null || command == _GitCommand.clone ? null : await _readHead(repositoryPath);
+    await super.run(command, args); // exits on failure
+    if (repositoryPath != null) {
+      await _reconcileChangedFiles(command, args, repositoryPath, oldHead);
+    }
+  }
 }
 
 void main(List<String> args) async